@@ -0,0 +1,824 @@
+#pragma once
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <utility>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace std;
+
+#pragma pack(push, 1)
+// File header - all BMP images starts with a five elements file header. This has information about the file type, file size and location of the pixel data
+// Bitmap Info header - This has information about the width/height of the image, bits depth
+// Color header - contains informations about the color space and bit masks
+struct BMPFileHeader
+{
+    uint16_t file_type{0x4D42}; // File type always BM which is 0x4D42 (stored as hex uint16_t in little endian)
+    uint32_t file_size{0};      // Size of the file (in bytes)
+    uint16_t reserved1{0};      // Reserved, always 0
+    uint16_t reserved2{0};      // Reserved, always 0
+    uint32_t offset_data{0};    // Start position of pixel data (bytes from the beginning of the file)
+};
+
+struct BMPInfoHeader
+{
+    uint32_t size{0};        // Size of this header (in bytes)
+    int32_t width{0};        // Width of bitmap in pixels
+    int32_t height{0};       // Height of bitmap in pixels
+                             // (if positive, bottom-up, with origin in lower left corner)
+                             // (if negative, top-down, with origin in upper left corner)
+    uint16_t planes{1};      // No. of planes for the target device, this is always 1
+    uint16_t bit_count{0};   // No. of bits per pixel
+    uint32_t compression{0}; // 0 or 3 - uncompressed. This Program considers only uncompressed BMP images
+    uint32_t size_image{0};  // 0 - for uncompressed images
+    int32_t x_pixels_per_meter{0};
+    int32_t y_pixels_per_meter{0};
+    uint32_t colors_used{0};      // No. of color indexes in the color table. Use 0 for the max number of colors allowed by bit_count
+    uint32_t colors_important{0}; // No. of colors used for displaying the bitmap. If 0 all colors are required
+};
+
+struct BMPColorHeader
+{
+    uint32_t red_mask{0x00ff0000};         // Bit mask for the Red channel
+    uint32_t green_mask{0x0000ff00};       // Bit mask for the Green channel
+    uint32_t blue_mask{0x000000ff};        // Bit mask for the Blue channel
+    uint32_t alpha_mask{0xff000000};       // Bit mask for the Alpha channel
+    uint32_t color_space_type{0x73524742}; // Default "sRGB" (0x73524742)
+    uint32_t unused[16]{0};                // Unused data for sRGB color space
+};
+#pragma pack(pop)
+
+// Check if the BI_BITFIELDS masks describe BGRA or BGRX pixel data. The color
+// space tag is not checked: the pipeline only reads the channel bytes.
+inline void check_color_header(const BMPColorHeader &bmp_color_header)
+{
+    BMPColorHeader expected_color_header;
+
+    if (expected_color_header.red_mask != bmp_color_header.red_mask ||
+        expected_color_header.blue_mask != bmp_color_header.blue_mask ||
+        expected_color_header.green_mask != bmp_color_header.green_mask ||
+        (bmp_color_header.alpha_mask != expected_color_header.alpha_mask && bmp_color_header.alpha_mask != 0))
+    {
+        throw runtime_error("Unexpected color mask format! The program expects the pixel data to be in the BGRA format");
+    }
+}
+
+// Read-only view of a BMP file mapped into memory. The headers are validated
+// once and the pixel rows are addressed where they lie in the file, so opening
+// a frame costs one open/fstat/mmap and no copy.
+struct BMPView
+{
+    BMPFileHeader file_header;
+    BMPInfoHeader bmp_info_header;
+    BMPColorHeader bmp_color_header;
+    const uint8_t *pixels{nullptr};      // First row as stored in the file
+    const uint8_t *color_table{nullptr}; // BGRA0 entries for bit counts <= 8, else null
+    uint32_t color_count{0};             // No. of entries in color_table
+    uint32_t row_stride{0};              // Bytes per stored row, including the padding to 4
+    int32_t width{0};
+    int32_t height{0};                   // Always positive, see bottom_up
+    bool bottom_up{true};                // Storage order, from the sign of the header height
+
+    BMPView(const char *fname)
+    {
+        int fd = open(fname, O_RDONLY);
+        if (fd < 0)
+        {
+            throw runtime_error("Unable to open the input image file.");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)(sizeof(BMPFileHeader) + sizeof(BMPInfoHeader)))
+        {
+            close(fd);
+            throw runtime_error("Error! Unrecognized file format.");
+        }
+        map_size = st.st_size;
+        map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            throw runtime_error("Unable to map the input image file.");
+        }
+        try
+        {
+            parse(fname);
+        }
+        catch (...)
+        {
+            munmap(map, map_size);
+            throw;
+        }
+    }
+
+    ~BMPView()
+    {
+        munmap(map, map_size);
+    }
+
+    BMPView(const BMPView &) = delete;
+    BMPView &operator=(const BMPView &) = delete;
+
+    // Row y of the picture counted from the top, whatever the storage order.
+    const uint8_t *row(int32_t y) const
+    {
+        return pixels + (size_t)(bottom_up ? height - 1 - y : y) * row_stride;
+    }
+
+    // Signed distance from picture row y to row y+1 (negative for bottom-up files).
+    ptrdiff_t top_down_stride() const
+    {
+        return bottom_up ? -(ptrdiff_t)row_stride : (ptrdiff_t)row_stride;
+    }
+
+private:
+    void *map{MAP_FAILED};
+    size_t map_size{0};
+
+    void parse(const char *fname)
+    {
+        const uint8_t *base = (const uint8_t *)map;
+        memcpy(&file_header, base, sizeof(file_header));
+        memcpy(&bmp_info_header, base + sizeof(file_header), sizeof(bmp_info_header));
+        if (file_header.file_type != 0x4D42 || bmp_info_header.size < sizeof(BMPInfoHeader))
+        {
+            throw runtime_error("Error! Unrecognized file format.");
+        }
+        if (bmp_info_header.planes != 1 || bmp_info_header.width <= 0 || bmp_info_header.height == 0)
+        {
+            throw runtime_error("Error! Invalid BMP dimensions.");
+        }
+
+        uint16_t bits = bmp_info_header.bit_count;
+        if (bits != 8 && bits != 24 && bits != 32)
+        {
+            throw runtime_error("The program can treat only 8, 24 or 32 bits per pixel BMP files");
+        }
+        if (bmp_info_header.compression != 0 && !(bits == 32 && bmp_info_header.compression == 3))
+        {
+            throw runtime_error("The program can treat only uncompressed BMP files");
+        }
+
+        size_t headers = sizeof(BMPFileHeader) + bmp_info_header.size;
+        if (bits == 32)
+        {
+            // BI_RGB is implicit B,G,R,X. BI_BITFIELDS keeps its masks in a V4/V5
+            // header, or for a plain 40 byte header in the 12 bytes after it.
+            bmp_color_header = BMPColorHeader();
+            bmp_color_header.alpha_mask = 0;
+            if (bmp_info_header.compression == 3)
+            {
+                size_t masks = bmp_info_header.size - sizeof(BMPInfoHeader);
+                if (masks == 0)
+                {
+                    masks = 3 * sizeof(uint32_t);
+                    headers += masks;
+                }
+                masks = min(masks, sizeof(BMPColorHeader));
+                if (masks < 3 * sizeof(uint32_t) || headers > map_size)
+                {
+                    cerr << "Error! The file \"" << fname << "\" does not seem to contain bit mask information\n";
+                    throw runtime_error("Error! Unrecognized file format.");
+                }
+                memcpy(&bmp_color_header, base + sizeof(BMPFileHeader) + sizeof(BMPInfoHeader), masks);
+                check_color_header(bmp_color_header);
+            }
+        }
+        else if (bits == 8)
+        {
+            color_count = bmp_info_header.colors_used ? bmp_info_header.colors_used : 256;
+            if (color_count > 256 || headers + color_count * 4 > map_size)
+            {
+                throw runtime_error("Error! Invalid BMP color table.");
+            }
+            color_table = base + headers;
+        }
+
+        width = bmp_info_header.width;
+        bottom_up = bmp_info_header.height > 0;
+        if (bmp_info_header.height == INT_MIN)
+        {
+            throw runtime_error("Error! Invalid BMP dimensions.");
+        }
+        height = bottom_up ? bmp_info_header.height : -bmp_info_header.height;
+        uint64_t stride = ((uint64_t)width * bits / 8 + 3) & ~(uint64_t)3;
+        if (stride > UINT32_MAX || file_header.offset_data < headers ||
+            (uint64_t)file_header.offset_data + stride * (uint64_t)height > map_size)
+        {
+            throw runtime_error("Error! The pixel data does not fit in the file.");
+        }
+        row_stride = (uint32_t)stride;
+        pixels = base + file_header.offset_data;
+    }
+};
+
+// ---- pixel format conversion ----
+// Row kernels that turn any BMPView into the pipeline's formats: 8 bit gray or 24 bit
+// BGR, top-down. The SSE2 and NEON paths give the same bytes as the scalar loops, and
+// the gray weights are OpenCV's cvtColor() fixed point, so results match it exactly.
+
+enum class PixelFormat
+{
+    Gray8,
+    BGR24
+};
+
+// Off in -bench's scalar pass, to time the kernels against their scalar loops.
+inline bool bmp_simd = true;
+
+const int GrayB = 3735, GrayG = 19235, GrayR = 9798, GrayShift = 15; // 0.114, 0.587, 0.299 in Q15
+
+inline uint8_t gray_of(int b, int g, int r)
+{
+    return (uint8_t)((b * GrayB + g * GrayG + r * GrayR + (1 << (GrayShift - 1))) >> GrayShift);
+}
+
+#if defined(__SSE2__)
+// 16 packed BGR pixels (48 bytes) split into one vector per channel. SSE2 has no byte
+// shuffle, so this is OpenCV's unpack ladder: each round interleaves the low half of
+// one vector with the high half of another, and four rounds sort the bytes by channel.
+inline void deinterleave3_sse2(const uint8_t *src, __m128i &b, __m128i &g, __m128i &r)
+{
+    __m128i t00 = _mm_loadu_si128((const __m128i *)src);
+    __m128i t01 = _mm_loadu_si128((const __m128i *)(src + 16));
+    __m128i t02 = _mm_loadu_si128((const __m128i *)(src + 32));
+
+    __m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+    __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+    __m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+
+    __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+    __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+    __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+    __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+    __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+    __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+    b = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+    g = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+    r = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+}
+#endif
+
+// 24 bit BGR (channels 3) or 32 bit BGRA (channels 4) to gray.
+inline void gray_from_bgr_row(const uint8_t *src, uint8_t *dst, int width, int channels)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    if (channels == 4)
+    {
+        // madd gives B*cb+G*cg and R*cr+A*0 per pixel; the shuffles add the halves
+        const __m128i coeffs = _mm_setr_epi16(GrayB, GrayG, GrayR, 0, GrayB, GrayG, GrayR, 0);
+        const __m128i round = _mm_set1_epi32(1 << (GrayShift - 1));
+        const __m128i zero = _mm_setzero_si128();
+        for (; bmp_simd && x <= width - 8; x += 8)
+        {
+            __m128i sums[2];
+            for (int k = 0; k < 2; k++)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + (x + 4 * k) * 4));
+                __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), coeffs);
+                __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), coeffs);
+                __m128 a = _mm_castsi128_ps(lo), b = _mm_castsi128_ps(hi);
+                __m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                __m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+                sums[k] = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), round), GrayShift);
+            }
+            __m128i words = _mm_packs_epi32(sums[0], sums[1]);
+            _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(words, words));
+        }
+    }
+    else
+    {
+        // 16 pixels deinterleaved into B, G and R vectors, then B*cb+G*cg and R*cr+round
+        // as two madds of interleaved words per 4 pixels
+        const __m128i bg_coeffs = _mm_setr_epi16(GrayB, GrayG, GrayB, GrayG, GrayB, GrayG, GrayB, GrayG);
+        const __m128i r_coeffs = _mm_setr_epi16(GrayR, 1, GrayR, 1, GrayR, 1, GrayR, 1);
+        const __m128i round = _mm_set1_epi16(1 << (GrayShift - 1));
+        const __m128i zero = _mm_setzero_si128();
+        for (; bmp_simd && x <= width - 16; x += 16)
+        {
+            __m128i b, g, r;
+            deinterleave3_sse2(src + x * 3, b, g, r);
+            __m128i bytes[2];
+            for (int half = 0; half < 2; half++)
+            {
+                __m128i b16 = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+                __m128i g16 = half ? _mm_unpackhi_epi8(g, zero) : _mm_unpacklo_epi8(g, zero);
+                __m128i r16 = half ? _mm_unpackhi_epi8(r, zero) : _mm_unpacklo_epi8(r, zero);
+                __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b16, g16), bg_coeffs),
+                                           _mm_madd_epi16(_mm_unpacklo_epi16(r16, round), r_coeffs));
+                __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b16, g16), bg_coeffs),
+                                           _mm_madd_epi16(_mm_unpackhi_epi16(r16, round), r_coeffs));
+                bytes[half] = _mm_packs_epi32(_mm_srli_epi32(lo, GrayShift), _mm_srli_epi32(hi, GrayShift));
+            }
+            _mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(bytes[0], bytes[1]));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; bmp_simd && x <= width - 8; x += 8)
+    {
+        uint8x8_t b, g, r;
+        if (channels == 4)
+        {
+            uint8x8x4_t p = vld4_u8(src + x * 4);
+            b = p.val[0], g = p.val[1], r = p.val[2];
+        }
+        else
+        {
+            uint8x8x3_t p = vld3_u8(src + x * 3);
+            b = p.val[0], g = p.val[1], r = p.val[2];
+        }
+        uint32x4_t lo = vmull_n_u16(vget_low_u16(vmovl_u8(b)), GrayB);
+        uint32x4_t hi = vmull_n_u16(vget_high_u16(vmovl_u8(b)), GrayB);
+        lo = vmlal_n_u16(lo, vget_low_u16(vmovl_u8(g)), GrayG);
+        hi = vmlal_n_u16(hi, vget_high_u16(vmovl_u8(g)), GrayG);
+        lo = vmlal_n_u16(lo, vget_low_u16(vmovl_u8(r)), GrayR);
+        hi = vmlal_n_u16(hi, vget_high_u16(vmovl_u8(r)), GrayR);
+        uint16x8_t words = vcombine_u16(vrshrn_n_u32(lo, GrayShift), vrshrn_n_u32(hi, GrayShift));
+        vst1_u8(dst + x, vmovn_u16(words));
+    }
+#endif
+    for (; x < width; x++)
+    {
+        const uint8_t *p = src + x * channels;
+        dst[x] = gray_of(p[0], p[1], p[2]);
+    }
+}
+
+// 32 bit BGRA to 24 bit BGR, alpha dropped.
+inline void bgr_from_bgra_row(const uint8_t *src, uint8_t *dst, int width)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    // Per 64 bit lane the two pixels are masked and shifted together into 6 bytes, then
+    // the high lane is moved down 2 bytes to close the gap. The 16 byte store leaves 4
+    // spare bytes that the next 4 pixels overwrite, so the loop stops 6 pixels short.
+    const __m128i first = _mm_set1_epi64x(0x0000000000ffffffLL);
+    const __m128i second = _mm_set1_epi64x(0x0000ffffff000000LL);
+    const __m128i low_lane = _mm_set_epi64x(0, -1);
+    for (; bmp_simd && x <= width - 6; x += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + x * 4));
+        __m128i p = _mm_or_si128(_mm_and_si128(v, first), _mm_and_si128(_mm_srli_epi64(v, 8), second));
+        p = _mm_or_si128(_mm_and_si128(p, low_lane), _mm_srli_si128(_mm_andnot_si128(low_lane, p), 2));
+        _mm_storeu_si128((__m128i *)(dst + x * 3), p);
+    }
+#elif defined(__ARM_NEON)
+    for (; bmp_simd && x <= width - 16; x += 16)
+    {
+        uint8x16x4_t p = vld4q_u8(src + x * 4);
+        uint8x16x3_t q = {{p.val[0], p.val[1], p.val[2]}};
+        vst3q_u8(dst + x * 3, q);
+    }
+#endif
+    // overlapping 4 byte copies, the spare byte is overwritten by the next pixel
+    for (; x < width - 1; x++)
+    {
+        memcpy(dst + x * 3, src + x * 4, 4);
+    }
+    for (; x < width; x++)
+    {
+        memcpy(dst + x * 3, src + x * 4, 3);
+    }
+}
+
+// Colour table of an 8 bit file as gray and as packed BGR (one spare byte per entry so
+// a pixel is a single 4 byte copy), plus one plane per channel for the NEON lookups.
+// Indexes past color_count read as black.
+struct PaletteTables
+{
+    uint8_t gray[256];
+    uint8_t bgr[256][4];
+    uint8_t planes[3][256];
+
+    explicit PaletteTables(const BMPView &view)
+    {
+        memset(gray, 0, sizeof(gray));
+        memset(bgr, 0, sizeof(bgr));
+        memset(planes, 0, sizeof(planes));
+        for (uint32_t i = 0; i < view.color_count; i++)
+        {
+            const uint8_t *e = view.color_table + i * 4;
+            gray[i] = gray_of(e[0], e[1], e[2]);
+            memcpy(bgr[i], e, 3);
+            for (int c = 0; c < 3; c++)
+            {
+                planes[c][i] = e[c];
+            }
+        }
+    }
+};
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+// A 256 byte table held in registers. AArch64 looks up 16 indexes at once as four 64
+// byte TBL/TBX steps; an index outside a step's 64 bytes leaves its lane alone.
+struct NeonTable
+{
+    enum { Lanes = 16 };
+    typedef uint8x16_t Vector;
+    uint8x16x4_t t[4];
+
+    explicit NeonTable(const uint8_t table[256])
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            t[k] = vld1q_u8_x4(table + 64 * k);
+        }
+    }
+
+    Vector operator()(Vector i) const
+    {
+        const uint8x16_t step = vdupq_n_u8(64);
+        Vector v = vqtbl4q_u8(t[0], i);
+        for (int k = 1; k < 4; k++)
+        {
+            i = vsubq_u8(i, step);
+            v = vqtbx4q_u8(v, t[k], i);
+        }
+        return v;
+    }
+
+    static Vector load(const uint8_t *p) { return vld1q_u8(p); }
+    static void store(uint8_t *p, Vector v) { vst1q_u8(p, v); }
+    static void store3(uint8_t *p, Vector b, Vector g, Vector r)
+    {
+        uint8x16x3_t q = {{b, g, r}};
+        vst3q_u8(p, q);
+    }
+};
+#elif defined(__ARM_NEON)
+// ARMv7 VTBL/VTBX reach only 32 table bytes and give 8 lanes, so the 256 byte table
+// takes eight steps per 8 indexes. The Pi's 32 bit armhf builds take this one.
+struct NeonTable
+{
+    enum { Lanes = 8 };
+    typedef uint8x8_t Vector;
+    uint8x8x4_t t[8];
+
+    explicit NeonTable(const uint8_t table[256])
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                t[k].val[j] = vld1_u8(table + 32 * k + 8 * j);
+            }
+        }
+    }
+
+    Vector operator()(Vector i) const
+    {
+        const uint8x8_t step = vdup_n_u8(32);
+        Vector v = vtbl4_u8(t[0], i);
+        for (int k = 1; k < 8; k++)
+        {
+            i = vsub_u8(i, step);
+            v = vtbx4_u8(v, t[k], i);
+        }
+        return v;
+    }
+
+    static Vector load(const uint8_t *p) { return vld1_u8(p); }
+    static void store(uint8_t *p, Vector v) { vst1_u8(p, v); }
+    static void store3(uint8_t *p, Vector b, Vector g, Vector r)
+    {
+        uint8x8x3_t q = {{b, g, r}};
+        vst3_u8(p, q);
+    }
+};
+#endif
+
+// Table lookup of every byte, vectorised on both NEON targets. SSE2 has no byte
+// gather, so x86 stays scalar.
+inline void lookup_row(const uint8_t *src, uint8_t *dst, int width, const uint8_t table[256])
+{
+    int x = 0;
+#if defined(__ARM_NEON)
+    if (bmp_simd && width >= NeonTable::Lanes)
+    {
+        NeonTable t(table);
+        for (; x <= width - NeonTable::Lanes; x += NeonTable::Lanes)
+        {
+            NeonTable::store(dst + x, t(NeonTable::load(src + x)));
+        }
+    }
+#endif
+    for (; x < width; x++)
+    {
+        dst[x] = table[src[x]];
+    }
+}
+
+// Palette indexes to 24 bit BGR. NEON looks each channel up in its own plane and
+// interleaves the three on the store; x86 copies the packed entries.
+inline void palette_bgr_row(const uint8_t *src, uint8_t *dst, int width, const PaletteTables &tables)
+{
+    int x = 0;
+#if defined(__ARM_NEON)
+    if (bmp_simd && width >= NeonTable::Lanes)
+    {
+        NeonTable b(tables.planes[0]), g(tables.planes[1]), r(tables.planes[2]);
+        for (; x <= width - NeonTable::Lanes; x += NeonTable::Lanes)
+        {
+            NeonTable::Vector i = NeonTable::load(src + x);
+            NeonTable::store3(dst + x * 3, b(i), g(i), r(i));
+        }
+    }
+#endif
+    for (; x < width - 1; x++)
+    {
+        memcpy(dst + x * 3, tables.bgr[src[x]], 4); // the spare byte is overwritten by the next pixel
+    }
+    for (; x < width; x++)
+    {
+        memcpy(dst + x * 3, tables.bgr[src[x]], 3);
+    }
+}
+
+// Swaps rows y and height-1-y in place, row_bytes of each, 16 bytes at a time.
+inline void flip_rows(uint8_t *data, size_t stride, int height, size_t row_bytes)
+{
+    for (int y = 0; y < height / 2; y++)
+    {
+        uint8_t *a = data + stride * y, *b = data + stride * (height - 1 - y);
+        size_t x = 0;
+#if defined(__SSE2__)
+        for (; bmp_simd && x + 16 <= row_bytes; x += 16)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+            _mm_storeu_si128((__m128i *)(a + x), vb);
+            _mm_storeu_si128((__m128i *)(b + x), va);
+        }
+#elif defined(__ARM_NEON)
+        for (; bmp_simd && x + 16 <= row_bytes; x += 16)
+        {
+            uint8x16_t va = vld1q_u8(a + x), vb = vld1q_u8(b + x);
+            vst1q_u8(a + x, vb);
+            vst1q_u8(b + x, va);
+        }
+#endif
+        for (; x < row_bytes; x++)
+        {
+            swap(a[x], b[x]);
+        }
+    }
+}
+
+// Converts a whole file into dst (view.height rows of dst_stride bytes, top row first).
+// Rows are read in picture order straight out of the mapping, so a bottom-up file is
+// flipped on the way through rather than by a separate pass.
+inline void convert_bmp(const BMPView &view, uint8_t *dst, size_t dst_stride, PixelFormat format)
+{
+    int bits = view.bmp_info_header.bit_count;
+    if (bits == 8)
+    {
+        PaletteTables palette(view);
+        for (int32_t y = 0; y < view.height; y++)
+        {
+            if (format == PixelFormat::Gray8)
+            {
+                lookup_row(view.row(y), dst + dst_stride * y, view.width, palette.gray);
+            }
+            else
+            {
+                palette_bgr_row(view.row(y), dst + dst_stride * y, view.width, palette);
+            }
+        }
+        return;
+    }
+    for (int32_t y = 0; y < view.height; y++)
+    {
+        const uint8_t *src = view.row(y);
+        uint8_t *out = dst + dst_stride * y;
+        if (format == PixelFormat::Gray8)
+        {
+            gray_from_bgr_row(src, out, view.width, bits / 8);
+        }
+        else if (bits == 32)
+        {
+            bgr_from_bgra_row(src, out, view.width);
+        }
+        else
+        {
+            memcpy(out, src, (size_t)view.width * 3);
+        }
+    }
+}
+
+struct Image
+{
+    BMPFileHeader file_header;
+    BMPInfoHeader bmp_info_header;
+    BMPColorHeader bmp_color_header;
+    vector<uint8_t> data;
+
+    Image(const char *fname)
+    {
+        read(fname);
+    }
+
+    void read(const char *fname)
+    {
+        // Headers are validated by the view; rows are copied straight out of
+        // the mapping instead of one stream read per row. data is always
+        // bottom-up 24 or 32 bit: top-down files are flipped and 8 bit ones
+        // expanded through their colour table.
+        BMPView view(fname);
+        file_header = view.file_header;
+        bmp_info_header = view.bmp_info_header;
+        if (bmp_info_header.bit_count == 32)
+        {
+            // Saved as BI_BITFIELDS either way; a BI_RGB source gets the view's BGRX masks
+            bmp_color_header = view.bmp_color_header;
+            bmp_info_header.compression = 3;
+        }
+
+        // Adjust the header fields for output
+        // Some editors will put extra info in the image file, we only save the headers and the data
+        bool palette = bmp_info_header.bit_count == 8;
+        if (palette)
+        {
+            bmp_info_header.bit_count = 24;
+            bmp_info_header.colors_used = 0;
+            bmp_info_header.colors_important = 0;
+        }
+        if (bmp_info_header.bit_count == 32)
+        {
+            bmp_info_header.size = sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
+            file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
+        }
+        else
+        {
+            bmp_info_header.size = sizeof(BMPInfoHeader);
+            file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader);
+        }
+        file_header.file_size = file_header.offset_data;
+        bmp_info_header.height = view.height;
+
+        row_stride = bmp_info_header.width * bmp_info_header.bit_count / 8;
+        data.resize(row_stride * bmp_info_header.height);
+        if (palette)
+        {
+            PaletteTables tables(view);
+            for (int y = 0; y < view.height; ++y)
+            {
+                palette_bgr_row(view.row(view.height - 1 - y), data.data() + row_stride * y, view.width, tables);
+            }
+        }
+        else if (row_stride == view.row_stride)
+        {
+            memcpy(data.data(), view.pixels, data.size());
+            if (!view.bottom_up)
+            {
+                flip_rows(data.data(), row_stride, view.height, row_stride);
+            }
+        }
+        else
+        {
+            for (int y = 0; y < view.height; ++y)
+            {
+                memcpy(data.data() + row_stride * y, view.row(view.height - 1 - y), row_stride);
+            }
+        }
+        uint32_t new_stride = make_stride_aligned(4);
+        file_header.file_size += static_cast<uint32_t>(data.size()) + bmp_info_header.height * (new_stride - row_stride);
+    }
+
+    Image(int32_t width, int32_t height, bool has_alpha = true)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            throw runtime_error("The image width and height must be positive numbers.");
+        }
+
+        bmp_info_header.width = width;
+        bmp_info_header.height = height;
+        if (has_alpha)
+        {
+            // Initializing the size of header and other parameters if alpha bit mask is present.
+            // alpha bit is bit mask in BMPColorHeader block.
+            bmp_info_header.size = sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
+            file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader) + sizeof(BMPColorHeader);
+
+            bmp_info_header.bit_count = 32;
+            bmp_info_header.compression = 3;
+            row_stride = width * 4;
+            data.resize(row_stride * height);
+            file_header.file_size = file_header.offset_data + data.size();
+        }
+        else
+        {
+            // Initializing the headers and parameters of BMP file with no alpha bit mask.
+            bmp_info_header.size = sizeof(BMPInfoHeader);
+            file_header.offset_data = sizeof(BMPFileHeader) + sizeof(BMPInfoHeader);
+
+            bmp_info_header.bit_count = 24;
+            bmp_info_header.compression = 0;
+            row_stride = width * 3;
+            data.resize(row_stride * height);
+
+            // Stride is the number of bytes your code must iterate past to reach the next vertical pixel
+            // adding pading using make_stride_aligned() function.
+            uint32_t new_stride = make_stride_aligned(4);
+            file_header.file_size = file_header.offset_data + static_cast<uint32_t>(data.size()) + bmp_info_header.height * (new_stride - row_stride);
+        }
+    }
+
+    void write(const char *fname)
+    {
+        if (bmp_info_header.bit_count != 32 && bmp_info_header.bit_count != 24)
+        {
+            throw runtime_error("The program can treat only 24 or 32 bits per pixel BMP files");
+        }
+        int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            throw runtime_error("Unable to open the output image file.");
+        }
+
+        // Headers, then the rows with their padding, gathered into as few
+        // writev() calls as IOV_MAX allows instead of two writes per row.
+        static const uint8_t padding_row[4] = {0, 0, 0, 0};
+        uint32_t new_stride = make_stride_aligned(4);
+        vector<iovec> iov;
+        iov.push_back({&file_header, sizeof(file_header)});
+        iov.push_back({&bmp_info_header, sizeof(bmp_info_header)});
+        if (bmp_info_header.bit_count == 32)
+        {
+            iov.push_back({&bmp_color_header, sizeof(bmp_color_header)});
+        }
+        if (new_stride == row_stride)
+        {
+            iov.push_back({data.data(), data.size()});
+        }
+        else
+        {
+            for (int y = 0; y < bmp_info_header.height; ++y)
+            {
+                iov.push_back({data.data() + row_stride * y, row_stride});
+                iov.push_back({(void *)padding_row, new_stride - row_stride});
+            }
+        }
+
+        bool ok = write_all(fd, iov);
+        close(fd);
+        if (!ok)
+        {
+            throw runtime_error("Unable to write the output image file.");
+        }
+    }
+
+private:
+    uint32_t row_stride{0};
+
+    // writev() every entry, resuming after short writes.
+    static bool write_all(int fd, vector<iovec> &iov)
+    {
+        size_t first = 0;
+        while (first < iov.size())
+        {
+            int count = (int)min(iov.size() - first, (size_t)IOV_MAX);
+            ssize_t written = writev(fd, &iov[first], count);
+            if (written < 0)
+            {
+                return false;
+            }
+            while (first < iov.size() && (size_t)written >= iov[first].iov_len)
+            {
+                written -= iov[first].iov_len;
+                first++;
+            }
+            if (written > 0)
+            {
+                iov[first].iov_base = (uint8_t *)iov[first].iov_base + written;
+                iov[first].iov_len -= written;
+            }
+        }
+        return true;
+    }
+
+    // Add 1 to the row_stride until it is divisible with align_stride
+    uint32_t make_stride_aligned(uint32_t align_stride)
+    {
+        uint32_t new_stride = row_stride;
+        while (new_stride % align_stride != 0)
+        {
+            new_stride++;
+        }
+        return new_stride;
+    }
+};
@@ -0,0 +1,42 @@
+# -batch on one worker and on several must write byte identical columnar files:
+# row i is input i whichever worker ran it, and no worker's state leaks into another's.
+# cmake -DLANE=<lane binary> -DREPO_ROOT=<repo> -DWORK=<scratch dir> [-DTHREADS=n] -P batch_determinism.cmake
+if (NOT THREADS)
+    set(THREADS 4)
+endif()
+
+# Every BMP in the repo, repeated so the work spreads over many chunks, with a
+# missing file now and then for the valid = 0 rows.
+file(GLOB_RECURSE bmps "${REPO_ROOT}/*.bmp")
+list(SORT bmps)
+list(LENGTH bmps count)
+if (count EQUAL 0)
+    message(FATAL_ERROR "No BMP files under ${REPO_ROOT}")
+endif()
+file(MAKE_DIRECTORY ${WORK})
+set(inputs ${WORK}/batch_inputs.txt)
+file(WRITE ${inputs} "")
+foreach (round RANGE 1 40)
+    foreach (bmp ${bmps})
+        file(APPEND ${inputs} "${bmp}\n")
+    endforeach()
+    file(APPEND ${inputs} "${WORK}/missing_${round}.bmp\n")
+endforeach()
+
+foreach (threads 1 ${THREADS})
+    execute_process(COMMAND ${LANE} -batch ${inputs} -threads ${threads} -batchout ${WORK}/batch_${threads}.col
+                    RESULT_VARIABLE failed)
+    if (failed)
+        message(FATAL_ERROR "-batch -threads ${threads} failed: ${failed}")
+    endif()
+endforeach()
+
+foreach (file batch_${THREADS}.col batch_${THREADS}.col.files)
+    string(REPLACE "_${THREADS}." "_1." single ${file})
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK}/${single} ${WORK}/${file}
+                    RESULT_VARIABLE differ)
+    if (differ)
+        message(FATAL_ERROR "FAIL ${file} differs from ${single}")
+    endif()
+endforeach()
+message("PASS -batch -threads 1 and -threads ${THREADS} wrote identical files")
@@ -0,0 +1,216 @@
+// Image.h's SIMD row kernels checked byte for byte against their scalar loops
+// (bmp_simd off), on odd widths and on bottom-up and top-down files of every
+// supported bit count. Prints PASS or the first mismatches and FAIL.
+#include "Image.h"
+#include <random>
+#include <string>
+
+static int failures = 0;
+static mt19937 rng(1234);
+
+static const int Widths[] = {1, 2, 3, 5, 6, 7, 8, 9, 15, 16, 17, 23, 31, 32, 33, 47, 63, 64, 65, 127, 333, 641};
+static const int Guard = 32; // bytes past the row that no kernel may touch
+
+static vector<uint8_t> random_bytes(size_t n)
+{
+    vector<uint8_t> v(n);
+    for (auto &b : v)
+    {
+        b = (uint8_t)rng();
+    }
+    return v;
+}
+
+static void expect(bool ok, const string &what)
+{
+    if (!ok && failures++ < 20)
+    {
+        cout << "mismatch: " << what << endl;
+    }
+}
+
+// Runs kernel into a guarded buffer of out_bytes, once with SIMD and once without,
+// and compares the rows and the guard bytes after them.
+template <typename Kernel>
+static void compare_paths(const string &name, int width, size_t out_bytes, Kernel kernel)
+{
+    vector<uint8_t> simd(out_bytes + Guard, 0xa5), scalar(out_bytes + Guard, 0xa5);
+    bmp_simd = true;
+    kernel(simd.data());
+    bmp_simd = false;
+    kernel(scalar.data());
+    bmp_simd = true;
+    expect(simd == scalar, name + " width " + to_string(width));
+    for (int i = 0; i < Guard; i++)
+    {
+        expect(scalar[out_bytes + i] == 0xa5, name + " writes past the row, width " + to_string(width));
+    }
+}
+
+static void test_row_kernels()
+{
+    for (int width : Widths)
+    {
+        for (int channels = 3; channels <= 4; channels++)
+        {
+            vector<uint8_t> src = random_bytes((size_t)width * channels);
+            compare_paths("gray_from_bgr_row/" + to_string(channels), width, width,
+                          [&](uint8_t *dst) { gray_from_bgr_row(src.data(), dst, width, channels); });
+        }
+
+        vector<uint8_t> bgra = random_bytes((size_t)width * 4);
+        compare_paths("bgr_from_bgra_row", width, (size_t)width * 3,
+                      [&](uint8_t *dst) { bgr_from_bgra_row(bgra.data(), dst, width); });
+
+        vector<uint8_t> table = random_bytes(256), index = random_bytes(width);
+        compare_paths("lookup_row", width, width,
+                      [&](uint8_t *dst) { lookup_row(index.data(), dst, width, table.data()); });
+    }
+
+    // the gray weights themselves, on the channel extremes
+    for (int v : {0, 1, 127, 128, 254, 255})
+    {
+        uint8_t px[16 * 3], gray[16];
+        memset(px, v, sizeof(px));
+        gray_from_bgr_row(px, gray, 16, 3);
+        expect(gray[0] == gray_of(v, v, v) && gray[15] == gray_of(v, v, v), "gray of level " + to_string(v));
+    }
+}
+
+static void put16(vector<uint8_t> &f, size_t at, uint16_t v) { memcpy(&f[at], &v, 2); }
+static void put32(vector<uint8_t> &f, size_t at, uint32_t v) { memcpy(&f[at], &v, 4); }
+
+// One picture (top row first) as a BMP file in either row order. 8 bit files get a
+// random colour table of colors entries; 32 bit ones are BI_RGB or BI_BITFIELDS.
+static vector<uint8_t> bmp_file(const vector<uint8_t> &picture, int width, int height, int bits,
+                                bool bottom_up, bool bitfields, const vector<uint8_t> &palette)
+{
+    uint32_t stride = ((uint32_t)width * bits / 8 + 3) & ~3u;
+    uint32_t info = bits == 32 && bitfields ? sizeof(BMPInfoHeader) + sizeof(BMPColorHeader) : sizeof(BMPInfoHeader);
+    uint32_t offset = sizeof(BMPFileHeader) + info + palette.size();
+    vector<uint8_t> f(offset + (size_t)stride * height, 0);
+    put16(f, 0, 0x4D42);
+    put32(f, 2, f.size());
+    put32(f, 10, offset);
+    put32(f, 14, info);
+    put32(f, 18, width);
+    put32(f, 22, bottom_up ? height : -height);
+    put16(f, 26, 1);
+    put16(f, 28, bits);
+    put32(f, 30, bits == 32 && bitfields ? 3 : 0);
+    if (bits == 8)
+    {
+        put32(f, 46, palette.size() / 4);
+    }
+    if (bits == 32 && bitfields)
+    {
+        BMPColorHeader masks;
+        memcpy(&f[sizeof(BMPFileHeader) + sizeof(BMPInfoHeader)], &masks, sizeof(masks));
+    }
+    if (!palette.empty())
+    {
+        memcpy(&f[sizeof(BMPFileHeader) + info], palette.data(), palette.size());
+    }
+    size_t row_bytes = (size_t)width * bits / 8;
+    for (int y = 0; y < height; y++)
+    {
+        int stored = bottom_up ? height - 1 - y : y;
+        memcpy(&f[offset + (size_t)stride * stored], &picture[row_bytes * y], row_bytes);
+    }
+    return f;
+}
+
+static vector<uint8_t> convert_file(const string &path, PixelFormat format, bool simd)
+{
+    BMPView view(path.c_str());
+    size_t stride = (size_t)view.width * (format == PixelFormat::Gray8 ? 1 : 3);
+    vector<uint8_t> out(stride * view.height);
+    bmp_simd = simd;
+    convert_bmp(view, out.data(), stride, format);
+    bmp_simd = true;
+    return out;
+}
+
+// Both row orders through convert_bmp() and Image, SIMD and scalar: all must agree.
+static void test_files()
+{
+    char dir[] = "/tmp/image_kernels_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        expect(false, "cannot create a scratch directory");
+        return;
+    }
+    const int height = 5;
+    for (int width : Widths)
+    {
+        for (int bits : {8, 24, 32})
+        {
+            for (bool bitfields : {false, true})
+            {
+                if (bitfields && bits != 32)
+                {
+                    continue;
+                }
+                vector<uint8_t> palette = bits == 8 ? random_bytes(200 * 4) : vector<uint8_t>();
+                vector<uint8_t> picture = random_bytes((size_t)width * bits / 8 * height);
+                string name = to_string(bits) + " bit" + (bitfields ? " bitfields" : "") + " width " + to_string(width);
+                vector<uint8_t> results[2][2][2]; // [bottom_up][format][simd]
+                vector<uint8_t> images[2];
+                for (int bottom_up = 0; bottom_up < 2; bottom_up++)
+                {
+                    string path = string(dir) + "/frame.bmp";
+                    vector<uint8_t> file = bmp_file(picture, width, height, bits, bottom_up, bitfields, palette);
+                    FILE *out = fopen(path.c_str(), "wb");
+                    fwrite(file.data(), 1, file.size(), out);
+                    fclose(out);
+                    for (int format = 0; format < 2; format++)
+                    {
+                        for (int simd = 0; simd < 2; simd++)
+                        {
+                            results[bottom_up][format][simd] =
+                                convert_file(path, format ? PixelFormat::BGR24 : PixelFormat::Gray8, simd);
+                        }
+                    }
+                    images[bottom_up] = Image(path.c_str()).data;
+                    unlink(path.c_str());
+                }
+                for (int format = 0; format < 2; format++)
+                {
+                    string what = name + (format ? " BGR24" : " Gray8");
+                    expect(results[0][format][1] == results[0][format][0], what + " top-down, SIMD against scalar");
+                    expect(results[1][format][1] == results[1][format][0], what + " bottom-up, SIMD against scalar");
+                    expect(results[0][format][0] == results[1][format][0], what + " bottom-up against top-down");
+                }
+                expect(images[0] == images[1], name + " Image::read bottom-up against top-down");
+            }
+        }
+    }
+    rmdir(dir);
+}
+
+static void test_flip_rows()
+{
+    for (int width : Widths)
+    {
+        for (int height : {1, 2, 3, 8})
+        {
+            size_t row_bytes = (size_t)width * 3, stride = row_bytes + 3;
+            vector<uint8_t> a = random_bytes(stride * height), b = a;
+            bmp_simd = true;
+            flip_rows(a.data(), stride, height, row_bytes);
+            bmp_simd = false;
+            flip_rows(b.data(), stride, height, row_bytes);
+            bmp_simd = true;
+            expect(a == b, "flip_rows width " + to_string(width) + " height " + to_string(height));
+        }
+    }
+}
+
+int main()
+{
+    test_row_kernels();
+    test_files();
+    test_flip_rows();
+    cout << (failures ? "FAIL" : "PASS") << " image kernels, " << failures << " mismatch(es)" << endl;
+    return failures ? 1 : 0;
+}